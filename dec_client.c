@@ -8,11 +8,29 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
 
 // Define buffer size for data transmission
 #define BUFFER_SIZE 70000
 // Define handshake message for client-server communication
 #define HANDSHAKE_MSG "DEC_CLIENT"
+// Define handshake message for streaming mode (ciphertext read from stdin)
+#define STREAM_HANDSHAKE_MSG "DEC_STREAM"
+// Define the number of characters sent to the server per streaming frame
+#define STREAM_CHUNK_SIZE 4096
+
+// Buffered reader used to pull characters from stdin or the key descriptor
+struct streamReader {
+    int fd;
+    char buffer[STREAM_CHUNK_SIZE];
+    size_t pos;
+    size_t len;
+};
 
 // Error handling function that prints error messages to stderr and exits the program
 void error(const char *msg) { 
@@ -62,6 +80,194 @@ void readFileIntoBuffer(const char *filename, char *buffer) {
     close(fd);
 }
 
+// Function to open the key source, either a file path or "fd:N" for an already open descriptor
+int openKeySource(const char *source) {
+    if (strncmp(source, "fd:", 3) == 0) {
+        char *end;
+        errno = 0;
+        long fd = strtol(source + 3, &end, 10);
+        // Accept only a plain descriptor number; stdin is taken by the streamed text
+        if (source[3] < '0' || source[3] > '9' || *end != '\0' || errno != 0 || fd > INT_MAX
+                || fd == STDIN_FILENO) {
+            fprintf(stderr, "Client: Error, invalid key descriptor %s\n", source);
+            exit(1);
+        }
+        if (fcntl(fd, F_GETFD) < 0) {
+            fprintf(stderr, "Client: Error, key descriptor %ld is not open\n", fd);
+            exit(1);
+        }
+        return (int) fd;
+    }
+    int fd = open(source, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Client: Error opening file %s\n", source);
+        exit(1);
+    }
+    return fd;
+}
+
+// Function to fill a chunk with up to wanted characters, skipping newlines
+// Returns fewer than wanted characters only at end of input
+size_t readChunk(struct streamReader *reader, char *chunk, size_t wanted, const char *name) {
+    size_t count = 0;
+    while (count < wanted) {
+        // Refill the reader buffer once it has been consumed
+        if (reader->pos == reader->len) {
+            ssize_t bytesRead = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+            if (bytesRead < 0) {
+                fprintf(stderr, "Client: Error reading %s\n", name);
+                exit(1);
+            }
+            if (bytesRead == 0) {
+                break;
+            }
+            reader->pos = 0;
+            reader->len = bytesRead;
+        }
+        char c = reader->buffer[reader->pos++];
+        if (c != '\n') {
+            chunk[count++] = c;
+        }
+    }
+    chunk[count] = '\0';
+    return count;
+}
+
+// Function to send an entire buffer, retrying on partial sends
+// Returns 0 if the server hung up; MSG_NOSIGNAL turns that into an error rather than SIGPIPE
+int sendAll(int socketFD, const char *data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsWritten = send(socketFD, data + total, length - total, MSG_NOSIGNAL);
+        if (charsWritten < 0) {
+            return 0;
+        }
+        total += charsWritten;
+    }
+    return 1;
+}
+
+// Function to receive exactly length bytes, returning 0 if the server closed the connection first
+int recvAll(int socketFD, char *data, size_t length, const char *msg) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsRead = recv(socketFD, data + total, length - total, 0);
+        if (charsRead < 0) {
+            error(msg);
+        }
+        if (charsRead == 0) {
+            return 0;
+        }
+        total += charsRead;
+    }
+    return 1;
+}
+
+// Function to stop a stream early: stop the reader so it writes nothing more, then reap it
+void abortStream(int socketFD, pid_t reader) {
+    kill(reader, SIGTERM);
+    waitpid(reader, NULL, 0);
+    close(socketFD);
+    exit(1);
+}
+
+// Function to stream ciphertext from stdin to the server in frames and plaintext back to stdout
+// Each frame is a 4-byte length in network byte order followed by that many ciphertext and key characters
+// The server answers each frame with a framed reply and ends with a zero-length reply
+int streamToServer(int socketFD, int keyFD) {
+    struct streamReader textReader, keyReader;
+    char textChunk[STREAM_CHUNK_SIZE + 1];
+    char keyChunk[STREAM_CHUNK_SIZE + 1];
+    char buffer[STREAM_CHUNK_SIZE];
+    int status;
+    int sent = 1;
+
+    // Set up the readers for stdin and the key
+    memset(&textReader, 0, sizeof(textReader));
+    memset(&keyReader, 0, sizeof(keyReader));
+    textReader.fd = STDIN_FILENO;
+    keyReader.fd = keyFD;
+
+    // Fork a reader so plaintext is written to stdout while later frames are still being sent
+    pid_t reader = fork();
+    if (reader < 0) {
+        error("Client: Error on fork");
+    }
+    if (reader == 0) {
+        while (1) {
+            // Each reply is a 4-byte length followed by that many plaintext characters
+            uint32_t replyHeader;
+            if (!recvAll(socketFD, (char*) &replyHeader, sizeof(replyHeader),
+                    "Client: Error reading plaintext from socket")) {
+                fprintf(stderr, "Client: Error, dec_server closed the stream early\n");
+                exit(2);
+            }
+            size_t length = ntohl(replyHeader);
+            // A zero-length reply means the server handled the whole stream
+            if (length == 0) {
+                break;
+            }
+            if (length > STREAM_CHUNK_SIZE
+                    || !recvAll(socketFD, buffer, length, "Client: Error reading plaintext from socket")) {
+                fprintf(stderr, "Client: Error, dec_server closed the stream early\n");
+                exit(2);
+            }
+            size_t total = 0;
+            while (total < length) {
+                ssize_t charsWritten = write(STDOUT_FILENO, buffer + total, length - total);
+                if (charsWritten < 0) {
+                    error("Client: Error writing plaintext");
+                }
+                total += charsWritten;
+            }
+        }
+        // End the output with a newline, matching the file mode
+        write(STDOUT_FILENO, "\n", 1);
+        exit(0);
+    }
+
+    while (1) {
+        // Read the next chunk of ciphertext, stopping at end of input
+        size_t length = readChunk(&textReader, textChunk, STREAM_CHUNK_SIZE, "ciphertext from stdin");
+        if (length == 0) {
+            break;
+        }
+
+        // Read the matching stretch of key
+        if (readChunk(&keyReader, keyChunk, length, "key") < length) {
+            fprintf(stderr, "Client: Error key is too short\n");
+            abortStream(socketFD, reader);
+        }
+
+        // Send the frame header, ciphertext and key; stop early if the server hung up
+        uint32_t header = htonl((uint32_t) length);
+        if (!sendAll(socketFD, (char*) &header, sizeof(header)) || !sendAll(socketFD, textChunk, length)
+                || !sendAll(socketFD, keyChunk, length)) {
+            sent = 0;
+            break;
+        }
+    }
+
+    // A zero-length frame marks the end of the stream
+    if (sent) {
+        uint32_t header = htonl(0);
+        sent = sendAll(socketFD, (char*) &header, sizeof(header));
+    }
+    shutdown(socketFD, SHUT_WR);
+
+    // Wait for the reader to drain the remaining plaintext
+    // If a send failed, the reader has already reported why the server hung up
+    if (waitpid(reader, &status, 0) < 0 || !WIFEXITED(status)) {
+        error("Client: Error waiting for reader");
+    }
+    close(socketFD);
+    if (!sent && WEXITSTATUS(status) == 0) {
+        fprintf(stderr, "Client: Error sending ciphertext\n");
+        return 2;
+    }
+    return WEXITSTATUS(status);
+}
+
 // Main function for decryption on the client side
 int main(int argc, char *argv[]) {
     int socketFD, portNumber, charsWritten, charsRead;
@@ -69,6 +275,7 @@ int main(int argc, char *argv[]) {
     char buffer[BUFFER_SIZE];
     char keyBuffer[BUFFER_SIZE];
     char ciphertextBuffer[BUFFER_SIZE];
+    int keyFD = -1;
 
     // Check if the correct number of arguments is provided
     if (argc < 4) { 
@@ -76,18 +283,26 @@ int main(int argc, char *argv[]) {
         exit(2); 
     } 
 
-    // Read the ciphertext file into the buffer
-    readFileIntoBuffer(argv[1], ciphertextBuffer);
-    // Read the key file into the buffer
-    readFileIntoBuffer(argv[2], keyBuffer);
+    // A ciphertext of "-" streams from stdin instead of loading a file
+    int streaming = strcmp(argv[1], "-") == 0;
 
-    // Check if the key is long enough to encrypt the ciphertext
-    if (strlen(keyBuffer) < strlen(ciphertextBuffer)) {
-        fprintf(stderr, "Client: Error key is too short\n");
-        exit(1);
-    } else if (strlen(keyBuffer) > strlen(ciphertextBuffer)) {
-        // Truncate the key to match the length of the plaintext
-        keyBuffer[strlen(ciphertextBuffer)] = '\0';
+    if (streaming) {
+        // Open the key source; it is read chunk by chunk alongside stdin
+        keyFD = openKeySource(argv[2]);
+    } else {
+        // Read the ciphertext file into the buffer
+        readFileIntoBuffer(argv[1], ciphertextBuffer);
+        // Read the key file into the buffer
+        readFileIntoBuffer(argv[2], keyBuffer);
+
+        // Check if the key is long enough to encrypt the ciphertext
+        if (strlen(keyBuffer) < strlen(ciphertextBuffer)) {
+            fprintf(stderr, "Client: Error key is too short\n");
+            exit(1);
+        } else if (strlen(keyBuffer) > strlen(ciphertextBuffer)) {
+            // Truncate the key to match the length of the plaintext
+            keyBuffer[strlen(ciphertextBuffer)] = '\0';
+        }
     }
 
     // Create a socket for communication
@@ -105,7 +320,14 @@ int main(int argc, char *argv[]) {
     }
 
     // Send handshake message to the server to initiate communication
-    charsWritten = send(socketFD, HANDSHAKE_MSG, strlen(HANDSHAKE_MSG), 0);
+    if (streaming) {
+        charsWritten = send(socketFD, STREAM_HANDSHAKE_MSG, strlen(STREAM_HANDSHAKE_MSG), 0);
+    } else {
+        charsWritten = send(socketFD, HANDSHAKE_MSG, strlen(HANDSHAKE_MSG), 0);
+    }
+    if (charsWritten < 0) {
+        error("Client: Error sending handshake");
+    }
 
     // Clear the buffer and receive the server's response
     memset(buffer, '\0', sizeof(buffer));
@@ -116,21 +338,27 @@ int main(int argc, char *argv[]) {
         exit(2);
     }
 
-    // Send the ciphertext to the server
-    charsWritten = send(socketFD, ciphertextBuffer, strlen(ciphertextBuffer), 0);
-    if (charsWritten < 0 || charsWritten < strlen(ciphertextBuffer)) {
-        error("Client: Error sending ciphertext");
+    // In streaming mode the rest of the exchange happens frame by frame
+    if (streaming) {
+        return streamToServer(socketFD, keyFD);
     }
 
-    // Send the key to the server
-    charsWritten = send(socketFD, keyBuffer, strlen(keyBuffer), 0);
-    if (charsWritten < 0 || charsWritten < strlen(keyBuffer)) {
+    // Send the request: the ciphertext length, then the ciphertext and the key (already trimmed to match)
+    uint32_t header = htonl((uint32_t) strlen(ciphertextBuffer));
+    if (!sendAll(socketFD, (char*) &header, sizeof(header))
+            || !sendAll(socketFD, ciphertextBuffer, strlen(ciphertextBuffer))) {
+        error("Client: Error sending ciphertext");
+    }
+    if (!sendAll(socketFD, keyBuffer, strlen(keyBuffer))) {
         error("Client: Error sending key");
     }
 
-    // Receive the decrypted plaintext from the server
+    // Receive the plaintext until the server closes the connection
+    size_t total = 0;
     memset(buffer, '\0', sizeof(buffer));
-    charsRead = recv(socketFD, buffer, sizeof(buffer) - 1, 0); 
+    while ((charsRead = recv(socketFD, buffer + total, sizeof(buffer) - 1 - total, 0)) > 0) {
+        total += charsRead;
+    }
     if (charsRead < 0) {
         error("Client: Error reading plaintext from socket");
     }
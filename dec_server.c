@@ -9,11 +9,42 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/resource.h>
 
 // Define buffer size for data transmission
 #define BUFFER_SIZE 70000
 // Define handshake message for client-server communication
 #define HANDSHAKE_MSG "DEC_SERVER"
+// Define handshake message sent by clients in streaming mode
+#define STREAM_CLIENT_MSG "DEC_STREAM"
+// Define the largest frame a streaming client may send
+#define STREAM_CHUNK_SIZE 4096
+// Define the largest request, in characters, scheduled as a small request
+#define SMALL_REQUEST_LIMIT 8192
+// Define how many characters a bulk request transforms before yielding the CPU
+#define BULK_SLICE_SIZE 4096
+// Define how many bulk requests may be transformed at once and the niceness they run at
+#define BULK_WORKERS 2
+#define BULK_NICE 10
+
+// Argument type for semctl, which callers must define themselves
+union semun {
+    int val;
+    struct semid_ds *buf;
+    unsigned short *array;
+};
+
+// System V semaphore counting free bulk slots; SEM_UNDO hands a slot back when its holder exits
+int bulkSlots = -1;
+// Set once this child has been scheduled as a bulk request
+int isBulk = 0;
+// Process ID of the listening server, the only process that may remove the bulk slots
+pid_t serverPid = 0;
 
 // Error handling function that prints error messages to stderr and exits the program
 void error(const char *msg) {
@@ -59,6 +90,194 @@ void decrypt(char *ciphertext, char *key, char *plaintext) {
     plaintext[i] = '\0';
 }
 
+// Function to remove the bulk slot semaphore; children inherit this exit handler, so only the
+// server process itself acts on it
+void removeBulkSlots(void) {
+    if (bulkSlots >= 0 && getpid() == serverPid) {
+        semctl(bulkSlots, 0, IPC_RMID);
+        bulkSlots = -1;
+    }
+}
+
+// Function to create the bulk slot semaphore shared by all children
+// The semaphore is removed whenever the server exits, including through error()
+void createBulkSlots(void) {
+    union semun arg;
+    serverPid = getpid();
+    bulkSlots = semget(IPC_PRIVATE, 1, IPC_CREAT | 0600);
+    if (bulkSlots < 0) {
+        error("Error creating bulk slots");
+    }
+    atexit(removeBulkSlots);
+    arg.val = BULK_WORKERS;
+    if (semctl(bulkSlots, 0, SETVAL, arg) < 0) {
+        error("Error initializing bulk slots");
+    }
+}
+
+// Signal handler that stops the server, removing the bulk slot semaphore on the way out
+void stopServer(int signo) {
+    (void) signo;
+    removeBulkSlots();
+    _exit(0);
+}
+
+// Function to mark this child as a bulk request, which runs at a lower priority from then on
+void becomeBulk(void) {
+    if (isBulk) {
+        return;
+    }
+    setpriority(PRIO_PROCESS, 0, BULK_NICE);
+    isBulk = 1;
+}
+
+// Function to wait for a free bulk slot before transforming one slice or frame
+// Small requests never wait here, so they run ahead of any bulk work still queued
+void takeBulkSlot(void) {
+    struct sembuf take = { 0, -1, SEM_UNDO };
+    while (semop(bulkSlots, &take, 1) < 0) {
+        if (errno != EINTR) {
+            error("Server: Error waiting for a bulk slot");
+        }
+    }
+}
+
+// Function to hand the bulk slot back so queued bulk work takes turns
+void releaseBulkSlot(void) {
+    struct sembuf give = { 0, 1, SEM_UNDO };
+    if (semop(bulkSlots, &give, 1) < 0) {
+        error("Server: Error releasing a bulk slot");
+    }
+}
+
+// Function to decrypt a bulk request one slice at a time, holding a bulk slot only for each slice
+// and yielding the CPU between slices
+void decryptInSlices(char *ciphertext, char *key, char *plaintext) {
+    size_t length = strlen(ciphertext);
+    for (size_t offset = 0; offset < length; offset += BULK_SLICE_SIZE) {
+        size_t end = offset + BULK_SLICE_SIZE < length ? offset + BULK_SLICE_SIZE : length;
+        // Temporarily end the input at the slice boundary
+        char saved = ciphertext[end];
+        ciphertext[end] = '\0';
+        takeBulkSlot();
+        decrypt(ciphertext + offset, key + offset, plaintext + offset);
+        releaseBulkSlot();
+        ciphertext[end] = saved;
+        // A slice that could not be transformed fails the whole request
+        if (strlen(plaintext + offset) != end - offset) {
+            plaintext[0] = '\0';
+            return;
+        }
+        sched_yield();
+    }
+}
+
+// Function to receive exactly length bytes, returning 0 if the client closed the connection first
+int recvAll(int socketFD, char *data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsRead = recv(socketFD, data + total, length - total, 0);
+        if (charsRead < 0) {
+            error("Server: Error reading from socket");
+        }
+        if (charsRead == 0) {
+            return 0;
+        }
+        total += charsRead;
+    }
+    return 1;
+}
+
+// Function to send an entire buffer, retrying on partial sends
+void sendAll(int socketFD, const char *data, size_t length, const char *msg) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsWritten = send(socketFD, data + total, length - total, 0);
+        if (charsWritten < 0) {
+            error(msg);
+        }
+        total += charsWritten;
+    }
+}
+
+// Function to serve a streaming client one frame at a time
+// Each frame is a 4-byte length in network byte order followed by that many ciphertext and key characters;
+// a zero-length frame ends the stream
+// Each reply is framed the same way, and a zero-length reply confirms the whole stream was handled
+void handleStream(int connectionSocket) {
+    char ciphertext[STREAM_CHUNK_SIZE + 1];
+    char key[STREAM_CHUNK_SIZE + 1];
+    // The reply header and plaintext share one buffer so each reply goes out in a single send
+    char reply[sizeof(uint32_t) + STREAM_CHUNK_SIZE + 1];
+    char *plaintext = reply + sizeof(uint32_t);
+    uint32_t header;
+    size_t streamed = 0;
+
+    while (1) {
+        if (!recvAll(connectionSocket, (char*) &header, sizeof(header))) {
+            fprintf(stderr, "Server: Error, stream ended before its final frame\n");
+            close(connectionSocket);
+            exit(1);
+        }
+        size_t length = ntohl(header);
+        if (length == 0) {
+            // Confirm the end of the stream
+            sendAll(connectionSocket, (char*) &header, sizeof(header), "Server: Error sending plaintext");
+            break;
+        }
+        if (length > STREAM_CHUNK_SIZE) {
+            fprintf(stderr, "Server: Error, frame of %zu characters is too large\n", length);
+            close(connectionSocket);
+            exit(1);
+        }
+
+        // Once a stream outgrows a small request it is scheduled as bulk work
+        streamed += length;
+        if (streamed > SMALL_REQUEST_LIMIT) {
+            becomeBulk();
+        }
+
+        // Receive the ciphertext and key for this frame
+        memset(ciphertext, '\0', sizeof(ciphertext));
+        memset(key, '\0', sizeof(key));
+        if (!recvAll(connectionSocket, ciphertext, length) || !recvAll(connectionSocket, key, length)) {
+            fprintf(stderr, "Server: Error, stream ended mid-frame\n");
+            close(connectionSocket);
+            exit(1);
+        }
+
+        // Transform the frame; a short result means the frame held characters we cannot handle
+        // Bulk frames hold a slot only while they are transformed, never while waiting on the client
+        memset(plaintext, '\0', STREAM_CHUNK_SIZE + 1);
+        if (isBulk) {
+            takeBulkSlot();
+        }
+        decrypt(ciphertext, key, plaintext);
+        if (isBulk) {
+            releaseBulkSlot();
+        }
+        if (strlen(plaintext) != length) {
+            fprintf(stderr, "Server: Error, invalid characters in stream\n");
+            close(connectionSocket);
+            exit(1);
+        }
+
+        // Send this frame's plaintext back before reading the next one
+        header = htonl((uint32_t) length);
+        memcpy(reply, &header, sizeof(header));
+        sendAll(connectionSocket, reply, sizeof(header) + length, "Server: Error sending plaintext");
+
+        // Bulk streams give up the CPU after every frame
+        if (isBulk) {
+            sched_yield();
+        }
+    }
+
+    // Close the connection socket
+    close(connectionSocket);
+    exit(0);
+}
+
 // Function to handle communication with a client
 void handleClient(int connectionSocket) {
     char buffer[BUFFER_SIZE];
@@ -69,7 +288,8 @@ void handleClient(int connectionSocket) {
     // Handshake with client
     memset(buffer, '\0', sizeof(buffer));
     int charsRead = recv(connectionSocket, buffer, sizeof(buffer) - 1, 0);
-    if (charsRead < 0 || strcmp(buffer, "DEC_CLIENT") != 0) {
+    int streaming = charsRead > 0 && strcmp(buffer, STREAM_CLIENT_MSG) == 0;
+    if (charsRead < 0 || (!streaming && strcmp(buffer, "DEC_CLIENT") != 0)) {
         fprintf(stderr, "Server: Error communicating with dec_client\n");
         close(connectionSocket);
         exit(2);
@@ -77,30 +297,45 @@ void handleClient(int connectionSocket) {
 
     // Send handshake response to client
     int charsWritten = send(connectionSocket, HANDSHAKE_MSG, strlen(HANDSHAKE_MSG), 0);
+    if (charsWritten < 0) {
+        error("Server: Error sending handshake");
+    }
 
-    // Receive ciphertext from client
-    memset(ciphertext, '\0', sizeof(ciphertext));
-    charsRead = recv(connectionSocket, ciphertext, sizeof(ciphertext) - 1, 0);
-    if (charsRead < 0) {
-        error("Server: Error reading ciphertext from socket");
+    // Streaming clients exchange data frame by frame instead of in one message
+    if (streaming) {
+        handleStream(connectionSocket);
     }
 
-    // Receive key from client
+    // Receive the request: a 4-byte length in network byte order, then that many ciphertext and key characters
+    uint32_t header;
+    size_t length = 0;
+    memset(ciphertext, '\0', sizeof(ciphertext));
     memset(key, '\0', sizeof(key));
-    charsRead = recv(connectionSocket, key, sizeof(key) - 1, 0);
-    if (charsRead < 0) {
-        error("Server: Error reading key from socket");
+    if (recvAll(connectionSocket, (char*) &header, sizeof(header))) {
+        length = ntohl(header);
+    }
+    // Reject requests that are empty, too large, cut short, or hold fewer characters than announced
+    if (length == 0 || length >= BUFFER_SIZE
+            || !recvAll(connectionSocket, ciphertext, length) || !recvAll(connectionSocket, key, length)
+            || strlen(ciphertext) != length || strlen(key) != length) {
+        fprintf(stderr, "Server: Error, malformed request\n");
+        close(connectionSocket);
+        exit(1);
     }
 
     // Perform decryption
-    decrypt(ciphertext, key, plaintext);
-
-    // Send decrypted plaintext back to client
-    charsWritten = send(connectionSocket, plaintext, strlen(plaintext), 0);
-    if (charsWritten < 0) {
-        error("Server: Error sending plaintext");
+    // Large requests are decrypted in slices, each waiting for a bulk slot, so small ones can jump ahead
+    memset(plaintext, '\0', sizeof(plaintext));
+    if (strlen(ciphertext) > SMALL_REQUEST_LIMIT) {
+        becomeBulk();
+        decryptInSlices(ciphertext, key, plaintext);
+    } else {
+        decrypt(ciphertext, key, plaintext);
     }
 
+    // Send the plaintext back; closing the connection marks its end
+    sendAll(connectionSocket, plaintext, strlen(plaintext), "Server: Error sending plaintext");
+
     // Close the connection socket
     close(connectionSocket);
     exit(0);
@@ -144,6 +379,16 @@ int main(int argc, char *argv[]) {
         error("sigaction");
     }
 
+    // Create the bulk slots and remove them again when the server is stopped
+    createBulkSlots();
+    struct sigaction stop;
+    stop.sa_handler = stopServer;
+    sigemptyset(&stop.sa_mask);
+    stop.sa_flags = 0;
+    if (sigaction(SIGINT, &stop, NULL) == -1 || sigaction(SIGTERM, &stop, NULL) == -1) {
+        error("sigaction");
+    }
+
     // Infinite loop to accept and handle incoming connections
     while (1) {
         // Accept a new connection
@@ -160,6 +405,8 @@ int main(int argc, char *argv[]) {
         if (pid == 0) {
             // In the child process, close the listening socket and handle the client
             close(listenSocket);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
             handleClient(connectionSocket);
         } else {
             // In the parent process, close the connection socket and continue accepting new connections
@@ -8,11 +8,31 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
 
 // Define buffer size for data transmission
 #define BUFFER_SIZE 70000
 // Define handshake message for client-server communication
 #define HANDSHAKE_MSG "ENC_CLIENT"
+// Define handshake message for streaming mode (plaintext read from stdin)
+#define STREAM_HANDSHAKE_MSG "ENC_STREAM"
+// Define the number of characters sent to the server per streaming frame
+#define STREAM_CHUNK_SIZE 4096
+// Define the reply header enc_server sends when it refuses the key
+#define STREAM_REFUSED 0xFFFFFFFFU
+
+// Buffered reader used to pull characters from stdin or the key descriptor
+struct streamReader {
+    int fd;
+    char buffer[STREAM_CHUNK_SIZE];
+    size_t pos;
+    size_t len;
+};
 
 // Error handling function that prints error messages to stderr and exits the program
 void error(const char *msg) { 
@@ -73,12 +93,213 @@ int containsInvalidCharacters(char *plaintext) {
     return 0;
 }
 
+// Function to open the key source, either a file path or "fd:N" for an already open descriptor
+int openKeySource(const char *source) {
+    if (strncmp(source, "fd:", 3) == 0) {
+        char *end;
+        errno = 0;
+        long fd = strtol(source + 3, &end, 10);
+        // Accept only a plain descriptor number; stdin is taken by the streamed text
+        if (source[3] < '0' || source[3] > '9' || *end != '\0' || errno != 0 || fd > INT_MAX
+                || fd == STDIN_FILENO) {
+            fprintf(stderr, "Client: Error, invalid key descriptor %s\n", source);
+            exit(1);
+        }
+        if (fcntl(fd, F_GETFD) < 0) {
+            fprintf(stderr, "Client: Error, key descriptor %ld is not open\n", fd);
+            exit(1);
+        }
+        return (int) fd;
+    }
+    int fd = open(source, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Client: Error opening file %s\n", source);
+        exit(1);
+    }
+    return fd;
+}
+
+// Function to fill a chunk with up to wanted characters, skipping newlines
+// Returns fewer than wanted characters only at end of input
+size_t readChunk(struct streamReader *reader, char *chunk, size_t wanted, const char *name) {
+    size_t count = 0;
+    while (count < wanted) {
+        // Refill the reader buffer once it has been consumed
+        if (reader->pos == reader->len) {
+            ssize_t bytesRead = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+            if (bytesRead < 0) {
+                fprintf(stderr, "Client: Error reading %s\n", name);
+                exit(1);
+            }
+            if (bytesRead == 0) {
+                break;
+            }
+            reader->pos = 0;
+            reader->len = bytesRead;
+        }
+        char c = reader->buffer[reader->pos++];
+        if (c != '\n') {
+            chunk[count++] = c;
+        }
+    }
+    chunk[count] = '\0';
+    return count;
+}
+
+// Function to send an entire buffer, retrying on partial sends
+// Returns 0 if the server hung up; MSG_NOSIGNAL turns that into an error rather than SIGPIPE
+int sendAll(int socketFD, const char *data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsWritten = send(socketFD, data + total, length - total, MSG_NOSIGNAL);
+        if (charsWritten < 0) {
+            return 0;
+        }
+        total += charsWritten;
+    }
+    return 1;
+}
+
+// Function to receive exactly length bytes, returning 0 if the server closed the connection first
+int recvAll(int socketFD, char *data, size_t length, const char *msg) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsRead = recv(socketFD, data + total, length - total, 0);
+        if (charsRead < 0) {
+            error(msg);
+        }
+        if (charsRead == 0) {
+            return 0;
+        }
+        total += charsRead;
+    }
+    return 1;
+}
+
+// Function to stop a stream early: stop the reader so it writes nothing more, then reap it
+void abortStream(int socketFD, pid_t reader) {
+    kill(reader, SIGTERM);
+    waitpid(reader, NULL, 0);
+    close(socketFD);
+    exit(1);
+}
+
+// Function to stream plaintext from stdin to the server in frames and ciphertext back to stdout
+// Each frame is a 4-byte length in network byte order followed by that many plaintext and key characters
+// The server answers each frame with a framed reply and ends with a zero-length reply
+int streamToServer(int socketFD, int keyFD) {
+    struct streamReader textReader, keyReader;
+    char textChunk[STREAM_CHUNK_SIZE + 1];
+    char keyChunk[STREAM_CHUNK_SIZE + 1];
+    char buffer[STREAM_CHUNK_SIZE];
+    int status;
+    int sent = 1;
+
+    // Set up the readers for stdin and the key
+    memset(&textReader, 0, sizeof(textReader));
+    memset(&keyReader, 0, sizeof(keyReader));
+    textReader.fd = STDIN_FILENO;
+    keyReader.fd = keyFD;
+
+    // Fork a reader so ciphertext is written to stdout while later frames are still being sent
+    pid_t reader = fork();
+    if (reader < 0) {
+        error("Client: Error on fork");
+    }
+    if (reader == 0) {
+        while (1) {
+            // Each reply is a 4-byte length followed by that many ciphertext characters
+            uint32_t replyHeader;
+            if (!recvAll(socketFD, (char*) &replyHeader, sizeof(replyHeader),
+                    "Client: Error reading ciphertext from socket")) {
+                fprintf(stderr, "Client: Error, enc_server closed the stream early\n");
+                exit(2);
+            }
+            // A refusal ends the stream; shutting the socket for writing stops the sender too
+            if (ntohl(replyHeader) == STREAM_REFUSED) {
+                fprintf(stderr, "Client: Error, enc_server refused to encrypt with this key\n");
+                shutdown(socketFD, SHUT_WR);
+                exit(1);
+            }
+            size_t length = ntohl(replyHeader);
+            // A zero-length reply means the server handled the whole stream
+            if (length == 0) {
+                break;
+            }
+            if (length > STREAM_CHUNK_SIZE
+                    || !recvAll(socketFD, buffer, length, "Client: Error reading ciphertext from socket")) {
+                fprintf(stderr, "Client: Error, enc_server closed the stream early\n");
+                exit(2);
+            }
+            size_t total = 0;
+            while (total < length) {
+                ssize_t charsWritten = write(STDOUT_FILENO, buffer + total, length - total);
+                if (charsWritten < 0) {
+                    error("Client: Error writing ciphertext");
+                }
+                total += charsWritten;
+            }
+        }
+        // End the output with a newline, matching the file mode
+        write(STDOUT_FILENO, "\n", 1);
+        exit(0);
+    }
+
+    while (1) {
+        // Read the next chunk of plaintext, stopping at end of input
+        size_t length = readChunk(&textReader, textChunk, STREAM_CHUNK_SIZE, "plaintext from stdin");
+        if (length == 0) {
+            break;
+        }
+
+        // Check for invalid characters in this chunk
+        if (containsInvalidCharacters(textChunk)) {
+            fprintf(stderr, "\nError, stdin contains invalid characters\n\n");
+            abortStream(socketFD, reader);
+        }
+
+        // Read the matching stretch of key
+        if (readChunk(&keyReader, keyChunk, length, "key") < length) {
+            fprintf(stderr, "Client: Error, key is too short for encryption\n");
+            abortStream(socketFD, reader);
+        }
+
+        // Send the frame header, plaintext and key; stop early if the server hung up
+        uint32_t header = htonl((uint32_t) length);
+        if (!sendAll(socketFD, (char*) &header, sizeof(header)) || !sendAll(socketFD, textChunk, length)
+                || !sendAll(socketFD, keyChunk, length)) {
+            sent = 0;
+            break;
+        }
+    }
+
+    // A zero-length frame marks the end of the stream
+    if (sent) {
+        uint32_t header = htonl(0);
+        sent = sendAll(socketFD, (char*) &header, sizeof(header));
+    }
+    shutdown(socketFD, SHUT_WR);
+
+    // Wait for the reader to drain the remaining ciphertext
+    // If a send failed, the reader has already reported why the server hung up
+    if (waitpid(reader, &status, 0) < 0 || !WIFEXITED(status)) {
+        error("Client: Error waiting for reader");
+    }
+    close(socketFD);
+    if (!sent && WEXITSTATUS(status) == 0) {
+        fprintf(stderr, "Client: Error sending plaintext\n");
+        return 2;
+    }
+    return WEXITSTATUS(status);
+}
+
 int main(int argc, char *argv[]) {
     int socketFD, portNumber, charsWritten, charsRead;
     struct sockaddr_in serverAddress;
     char buffer[BUFFER_SIZE];
     char keyBuffer[BUFFER_SIZE];
     char plaintextBuffer[BUFFER_SIZE];
+    int keyFD = -1;
 
     // Check if the correct number of arguments is provided
     if (argc < 4) { 
@@ -86,24 +307,32 @@ int main(int argc, char *argv[]) {
         exit(2); 
     } 
 
-    // Read the plaintext file into a buffer
-    readFileIntoBuffer(argv[1], plaintextBuffer);
-    // Read the key file into a buffer
-    readFileIntoBuffer(argv[2], keyBuffer);
+    // A plaintext of "-" streams from stdin instead of loading a file
+    int streaming = strcmp(argv[1], "-") == 0;
 
-    // Check if the key is long enough
-    if (strlen(keyBuffer) < strlen(plaintextBuffer)) {
-        fprintf(stderr, "Client: Error, key is too short for encryption\n");
-        exit(1);
-    } else if (strlen(keyBuffer) > strlen(plaintextBuffer)) {
-        // Truncate the key to match the length of the plaintext
-        keyBuffer[strlen(plaintextBuffer)] = '\0';
-    }
+    if (streaming) {
+        // Open the key source; it is read chunk by chunk alongside stdin
+        keyFD = openKeySource(argv[2]);
+    } else {
+        // Read the plaintext file into a buffer
+        readFileIntoBuffer(argv[1], plaintextBuffer);
+        // Read the key file into a buffer
+        readFileIntoBuffer(argv[2], keyBuffer);
 
-    // Check for invalid characters in plaintext
-    if (containsInvalidCharacters(plaintextBuffer)) {
-        fprintf(stderr, "\nError, %s contains invalid characters\n\n", argv[1]);
-        exit(1);
+        // Check if the key is long enough
+        if (strlen(keyBuffer) < strlen(plaintextBuffer)) {
+            fprintf(stderr, "Client: Error, key is too short for encryption\n");
+            exit(1);
+        } else if (strlen(keyBuffer) > strlen(plaintextBuffer)) {
+            // Truncate the key to match the length of the plaintext
+            keyBuffer[strlen(plaintextBuffer)] = '\0';
+        }
+
+        // Check for invalid characters in plaintext
+        if (containsInvalidCharacters(plaintextBuffer)) {
+            fprintf(stderr, "\nError, %s contains invalid characters\n\n", argv[1]);
+            exit(1);
+        }
     }
 
     // Create a socket
@@ -121,7 +350,14 @@ int main(int argc, char *argv[]) {
     }
 
     // Handshake with server
-    charsWritten = send(socketFD, HANDSHAKE_MSG, strlen(HANDSHAKE_MSG), 0);
+    if (streaming) {
+        charsWritten = send(socketFD, STREAM_HANDSHAKE_MSG, strlen(STREAM_HANDSHAKE_MSG), 0);
+    } else {
+        charsWritten = send(socketFD, HANDSHAKE_MSG, strlen(HANDSHAKE_MSG), 0);
+    }
+    if (charsWritten < 0) {
+        error("Client: Error sending handshake");
+    }
 
     // Clear the buffer
     memset(buffer, '\0', sizeof(buffer));
@@ -133,24 +369,36 @@ int main(int argc, char *argv[]) {
         exit(2);
     }
 
-    // Send plaintext to server
-    charsWritten = send(socketFD, plaintextBuffer, strlen(plaintextBuffer), 0);
-    if (charsWritten < 0 || charsWritten < strlen(plaintextBuffer)) {
-        error("Client: Error sending plaintext");
+    // In streaming mode the rest of the exchange happens frame by frame
+    if (streaming) {
+        return streamToServer(socketFD, keyFD);
     }
 
-    // Send key to server
-    charsWritten = send(socketFD, keyBuffer, strlen(keyBuffer), 0);
-    if (charsWritten < 0 || charsWritten < strlen(keyBuffer)) {
+    // Send the request: the plaintext length, then the plaintext and the key (already trimmed to match)
+    uint32_t header = htonl((uint32_t) strlen(plaintextBuffer));
+    if (!sendAll(socketFD, (char*) &header, sizeof(header))
+            || !sendAll(socketFD, plaintextBuffer, strlen(plaintextBuffer))) {
+        error("Client: Error sending plaintext");
+    }
+    if (!sendAll(socketFD, keyBuffer, strlen(keyBuffer))) {
         error("Client: Error sending key");
     }
 
-    // Get ciphertext from server
+    // Receive the ciphertext until the server closes the connection
+    size_t total = 0;
     memset(buffer, '\0', sizeof(buffer));
-    charsRead = recv(socketFD, buffer, sizeof(buffer) - 1, 0); 
+    while ((charsRead = recv(socketFD, buffer + total, sizeof(buffer) - 1 - total, 0)) > 0) {
+        total += charsRead;
+    }
     if (charsRead < 0) {
         error("Client: Error reading ciphertext from socket");
     }
+    // An empty reply means the server refused the request, e.g. because the key was already used
+    if (total == 0) {
+        fprintf(stderr, "Client: Error, enc_server refused to encrypt with this key\n");
+        close(socketFD);
+        exit(1);
+    }
 
     // Print the received ciphertext
     printf("%s\n", buffer);
@@ -9,11 +9,58 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Define buffer size for data transmission
 #define BUFFER_SIZE 70000
 // Define handshake message for server-client communication
 #define HANDSHAKE_MSG "ENC_SERVER"
+// Define handshake message sent by clients in streaming mode
+#define STREAM_CLIENT_MSG "ENC_STREAM"
+// Define the largest frame a streaming client may send
+#define STREAM_CHUNK_SIZE 4096
+// Define the reply header that tells a streaming client its key was refused
+#define STREAM_REFUSED 0xFFFFFFFFU
+// Define the largest request, in characters, scheduled as a small request
+#define SMALL_REQUEST_LIMIT 8192
+// Define how many characters a bulk request transforms before yielding the CPU
+#define BULK_SLICE_SIZE 4096
+// Define how many bulk requests may be transformed at once and the niceness they run at
+#define BULK_WORKERS 2
+#define BULK_NICE 10
+// Define the number of key characters fingerprinted together in the pad-reuse index (the window width)
+#define KEY_SEGMENT_SIZE 16
+// Define the size of the pad-reuse index in bits (16 MiB on disk) and the hashes per segment
+// At one million recorded segments the false positive rate per checked window stays below 1e-9
+#define PAD_INDEX_BITS (1UL << 27)
+#define PAD_INDEX_HASHES 8
+// Define the multiplier of the rolling hash over key windows
+#define WINDOW_HASH_BASE 0x100000001b3ULL
+
+// Pad-reuse index: a Bloom filter over key segments, mmap'd from a file and shared by all children
+unsigned char *padIndex = NULL;
+int padIndexFD = -1;
+
+// Argument type for semctl, which callers must define themselves
+union semun {
+    int val;
+    struct semid_ds *buf;
+    unsigned short *array;
+};
+
+// System V semaphore counting free bulk slots; SEM_UNDO hands a slot back when its holder exits
+int bulkSlots = -1;
+// Set once this child has been scheduled as a bulk request
+int isBulk = 0;
+// Process ID of the listening server, the only process that may remove the bulk slots
+pid_t serverPid = 0;
 
 // Error handling function that prints error messages to stderr and exits the program
 void error(const char *msg) {
@@ -33,6 +80,121 @@ void setupAddressStruct(struct sockaddr_in* address, int portNumber) {
     address->sin_addr.s_addr = INADDR_ANY;
 }
 
+// Function to open (or create) the pad-reuse index file and map it into memory
+void openPadIndex(const char *path) {
+    struct stat info;
+    size_t size = PAD_INDEX_BITS / 8;
+
+    padIndexFD = open(path, O_RDWR | O_CREAT, 0600);
+    if (padIndexFD < 0) {
+        error("Error opening pad index");
+    }
+    // Grow a new or short file to the full index size; new bytes read as zero
+    if (fstat(padIndexFD, &info) < 0) {
+        error("Error reading pad index");
+    }
+    if ((size_t) info.st_size < size && ftruncate(padIndexFD, size) < 0) {
+        error("Error sizing pad index");
+    }
+    padIndex = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, padIndexFD, 0);
+    if (padIndex == MAP_FAILED) {
+        error("Error mapping pad index");
+    }
+}
+
+// Function to lock (F_WRLCK) or unlock (F_UNLCK) the whole pad-reuse index, waiting for other children
+void lockPadIndex(short type) {
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    while (fcntl(padIndexFD, F_SETLKW, &lock) < 0) {
+        if (errno != EINTR) {
+            error("Server: Error locking pad index");
+        }
+    }
+}
+
+// Function to hash the KEY_SEGMENT_SIZE characters starting at window (polynomial hash, so it can roll)
+uint64_t hashWindow(const char *window) {
+    uint64_t hash = 0;
+    for (int i = 0; i < KEY_SEGMENT_SIZE; i++) {
+        hash = hash * WINDOW_HASH_BASE + (unsigned char) window[i];
+    }
+    return hash;
+}
+
+// Function to scramble a 64-bit value (splitmix64 finaliser)
+uint64_t mixHash(uint64_t hash) {
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+// Function to visit the Bloom filter bits of one window, setting them if record is true
+// Returns 1 if every bit was already set
+int visitWindowBits(uint64_t windowHash, int record) {
+    uint64_t h1 = mixHash(windowHash);
+    // Derive the second hash by remixing the first; odd so probes never repeat
+    uint64_t h2 = mixHash(h1) | 1;
+
+    int allSet = 1;
+    for (int i = 0; i < PAD_INDEX_HASHES; i++) {
+        uint64_t bit = (h1 + i * h2) % PAD_INDEX_BITS;
+        unsigned char mask = 1 << (bit % 8);
+        if (!(padIndex[bit / 8] & mask)) {
+            allSet = 0;
+            if (record) {
+                padIndex[bit / 8] |= mask;
+            }
+        }
+    }
+    return allSet;
+}
+
+// Function to check a stretch of key against the pad-reuse index and record it if unused
+// Only full KEY_SEGMENT_SIZE segments aligned to the start of the stretch are recorded, but every
+// window is checked, so any reused run of at least 2 * KEY_SEGMENT_SIZE - 1 characters is caught
+// at whatever offset it reappears; shorter stretches are neither checked nor recorded
+// Returns 1 if the key was already used (nothing is recorded), 0 otherwise
+int checkAndRecordKey(const char *key, size_t length) {
+    size_t offset;
+    int reused = 0;
+
+    // Without an index file, reuse detection is disabled
+    if (padIndex == NULL || length < KEY_SEGMENT_SIZE) {
+        return 0;
+    }
+
+    // WINDOW_HASH_BASE^(KEY_SEGMENT_SIZE - 1), the weight of the character leaving a rolling window
+    uint64_t leadingWeight = 1;
+    for (int i = 1; i < KEY_SEGMENT_SIZE; i++) {
+        leadingWeight *= WINDOW_HASH_BASE;
+    }
+
+    // Hold a record lock on the index so concurrent children cannot both accept the same key
+    // (fcntl locks belong to each process, unlike flock locks, which forked children would share)
+    lockPadIndex(F_WRLCK);
+    // Check every window, rolling the hash forward one character at a time
+    uint64_t hash = hashWindow(key);
+    for (offset = 0; !reused; offset++) {
+        reused = visitWindowBits(hash, 0);
+        if (offset + KEY_SEGMENT_SIZE >= length) {
+            break;
+        }
+        hash = (hash - (unsigned char) key[offset] * leadingWeight) * WINDOW_HASH_BASE
+            + (unsigned char) key[offset + KEY_SEGMENT_SIZE];
+    }
+    // Record the aligned segments only, which keeps the index small
+    if (!reused) {
+        for (offset = 0; offset + KEY_SEGMENT_SIZE <= length; offset += KEY_SEGMENT_SIZE) {
+            visitWindowBits(hashWindow(key + offset), 1);
+        }
+    }
+    lockPadIndex(F_UNLCK);
+    return reused;
+}
+
 // Function to encrypt plaintext using a key
 void encrypt(char *plaintext, char *key, char *ciphertext) {
     int i, j;
@@ -75,6 +237,218 @@ void encrypt(char *plaintext, char *key, char *ciphertext) {
     }
 }
 
+// Function to remove the bulk slot semaphore; children inherit this exit handler, so only the
+// server process itself acts on it
+void removeBulkSlots(void) {
+    if (bulkSlots >= 0 && getpid() == serverPid) {
+        semctl(bulkSlots, 0, IPC_RMID);
+        bulkSlots = -1;
+    }
+}
+
+// Function to create the bulk slot semaphore shared by all children
+// The semaphore is removed whenever the server exits, including through error()
+void createBulkSlots(void) {
+    union semun arg;
+    serverPid = getpid();
+    bulkSlots = semget(IPC_PRIVATE, 1, IPC_CREAT | 0600);
+    if (bulkSlots < 0) {
+        error("Error creating bulk slots");
+    }
+    atexit(removeBulkSlots);
+    arg.val = BULK_WORKERS;
+    if (semctl(bulkSlots, 0, SETVAL, arg) < 0) {
+        error("Error initializing bulk slots");
+    }
+}
+
+// Signal handler that stops the server, removing the bulk slot semaphore on the way out
+void stopServer(int signo) {
+    (void) signo;
+    removeBulkSlots();
+    _exit(0);
+}
+
+// Function to mark this child as a bulk request, which runs at a lower priority from then on
+void becomeBulk(void) {
+    if (isBulk) {
+        return;
+    }
+    setpriority(PRIO_PROCESS, 0, BULK_NICE);
+    isBulk = 1;
+}
+
+// Function to wait for a free bulk slot before transforming one slice or frame
+// Small requests never wait here, so they run ahead of any bulk work still queued
+void takeBulkSlot(void) {
+    struct sembuf take = { 0, -1, SEM_UNDO };
+    while (semop(bulkSlots, &take, 1) < 0) {
+        if (errno != EINTR) {
+            error("Server: Error waiting for a bulk slot");
+        }
+    }
+}
+
+// Function to hand the bulk slot back so queued bulk work takes turns
+void releaseBulkSlot(void) {
+    struct sembuf give = { 0, 1, SEM_UNDO };
+    if (semop(bulkSlots, &give, 1) < 0) {
+        error("Server: Error releasing a bulk slot");
+    }
+}
+
+// Function to encrypt a bulk request one slice at a time, holding a bulk slot only for each slice
+// and yielding the CPU between slices
+void encryptInSlices(char *plaintext, char *key, char *ciphertext) {
+    size_t length = strlen(plaintext);
+    for (size_t offset = 0; offset < length; offset += BULK_SLICE_SIZE) {
+        size_t end = offset + BULK_SLICE_SIZE < length ? offset + BULK_SLICE_SIZE : length;
+        // Temporarily end the input at the slice boundary
+        char saved = plaintext[end];
+        plaintext[end] = '\0';
+        takeBulkSlot();
+        encrypt(plaintext + offset, key + offset, ciphertext + offset);
+        releaseBulkSlot();
+        plaintext[end] = saved;
+        // A slice that could not be transformed fails the whole request
+        if (strlen(ciphertext + offset) != end - offset) {
+            ciphertext[0] = '\0';
+            return;
+        }
+        sched_yield();
+    }
+}
+
+// Function to receive exactly length bytes, returning 0 if the client closed the connection first
+int recvAll(int socketFD, char *data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsRead = recv(socketFD, data + total, length - total, 0);
+        if (charsRead < 0) {
+            error("Server: Error reading from socket");
+        }
+        if (charsRead == 0) {
+            return 0;
+        }
+        total += charsRead;
+    }
+    return 1;
+}
+
+// Function to send an entire buffer, retrying on partial sends
+void sendAll(int socketFD, const char *data, size_t length, const char *msg) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t charsWritten = send(socketFD, data + total, length - total, 0);
+        if (charsWritten < 0) {
+            error(msg);
+        }
+        total += charsWritten;
+    }
+}
+
+// Function to end a refused connection: stop sending, then drain what the client already sent so
+// that closing the socket does not reset the connection and lose the refusal
+void refuseConnection(int connectionSocket) {
+    char buffer[STREAM_CHUNK_SIZE];
+    shutdown(connectionSocket, SHUT_WR);
+    while (recv(connectionSocket, buffer, sizeof(buffer), 0) > 0) {
+    }
+    close(connectionSocket);
+    exit(1);
+}
+
+// Function to refuse a stream: send the refusal header, then end the connection cleanly
+void refuseStream(int connectionSocket) {
+    uint32_t header = htonl(STREAM_REFUSED);
+    sendAll(connectionSocket, (char*) &header, sizeof(header), "Server: Error sending refusal");
+    refuseConnection(connectionSocket);
+}
+
+// Function to serve a streaming client one frame at a time
+// Each frame is a 4-byte length in network byte order followed by that many plaintext and key characters;
+// a zero-length frame ends the stream
+// Each reply is framed the same way, and a zero-length reply confirms the whole stream was handled
+void handleStream(int connectionSocket) {
+    char plaintext[STREAM_CHUNK_SIZE + 1];
+    char key[STREAM_CHUNK_SIZE + 1];
+    // The reply header and ciphertext share one buffer so each reply goes out in a single send
+    char reply[sizeof(uint32_t) + STREAM_CHUNK_SIZE + 1];
+    char *ciphertext = reply + sizeof(uint32_t);
+    uint32_t header;
+    size_t streamed = 0;
+
+    while (1) {
+        if (!recvAll(connectionSocket, (char*) &header, sizeof(header))) {
+            fprintf(stderr, "Server: Error, stream ended before its final frame\n");
+            close(connectionSocket);
+            exit(1);
+        }
+        size_t length = ntohl(header);
+        if (length == 0) {
+            // Confirm the end of the stream
+            sendAll(connectionSocket, (char*) &header, sizeof(header), "Server: Error sending ciphertext");
+            break;
+        }
+        if (length > STREAM_CHUNK_SIZE) {
+            fprintf(stderr, "Server: Error, frame of %zu characters is too large\n", length);
+            close(connectionSocket);
+            exit(1);
+        }
+
+        // Once a stream outgrows a small request it is scheduled as bulk work
+        streamed += length;
+        if (streamed > SMALL_REQUEST_LIMIT) {
+            becomeBulk();
+        }
+
+        // Receive the plaintext and key for this frame
+        memset(plaintext, '\0', sizeof(plaintext));
+        memset(key, '\0', sizeof(key));
+        if (!recvAll(connectionSocket, plaintext, length) || !recvAll(connectionSocket, key, length)) {
+            fprintf(stderr, "Server: Error, stream ended mid-frame\n");
+            close(connectionSocket);
+            exit(1);
+        }
+
+        // Transform the frame; a short result means the frame held characters we cannot handle
+        // Bulk frames hold a slot only while they are transformed, never while waiting on the client
+        memset(ciphertext, '\0', STREAM_CHUNK_SIZE + 1);
+        if (isBulk) {
+            takeBulkSlot();
+        }
+        encrypt(plaintext, key, ciphertext);
+        if (isBulk) {
+            releaseBulkSlot();
+        }
+        if (strlen(ciphertext) != length) {
+            fprintf(stderr, "Server: Error, invalid characters in stream\n");
+            close(connectionSocket);
+            exit(1);
+        }
+
+        // Refuse to encrypt with key material that has been used before
+        if (checkAndRecordKey(key, length)) {
+            fprintf(stderr, "Server: Error, key has already been used\n");
+            refuseStream(connectionSocket);
+        }
+
+        // Send this frame's ciphertext back before reading the next one
+        header = htonl((uint32_t) length);
+        memcpy(reply, &header, sizeof(header));
+        sendAll(connectionSocket, reply, sizeof(header) + length, "Server: Error sending ciphertext");
+
+        // Bulk streams give up the CPU after every frame
+        if (isBulk) {
+            sched_yield();
+        }
+    }
+
+    // Close the connection socket
+    close(connectionSocket);
+    exit(0);
+}
+
 // Function to handle client connections
 void handleClient(int connectionSocket) {
     char buffer[BUFFER_SIZE];
@@ -85,7 +459,8 @@ void handleClient(int connectionSocket) {
     // Handshake with client
     memset(buffer, '\0', sizeof(buffer));
     int charsRead = recv(connectionSocket, buffer, sizeof(buffer) - 1, 0);
-    if (charsRead < 0 || strcmp(buffer, "ENC_CLIENT") != 0) {
+    int streaming = charsRead > 0 && strcmp(buffer, STREAM_CLIENT_MSG) == 0;
+    if (charsRead < 0 || (!streaming && strcmp(buffer, "ENC_CLIENT") != 0)) {
         fprintf(stderr, "Server: Error communicating with enc_client\n");
         close(connectionSocket);
         exit(2);
@@ -93,30 +468,51 @@ void handleClient(int connectionSocket) {
 
     // Send handshake response
     int charsWritten = send(connectionSocket, HANDSHAKE_MSG, strlen(HANDSHAKE_MSG), 0);
+    if (charsWritten < 0) {
+        error("Server: Error sending handshake");
+    }
 
-    // Receive plaintext
-    memset(plaintext, '\0', sizeof(plaintext));
-    charsRead = recv(connectionSocket, plaintext, sizeof(plaintext) - 1, 0);
-    if (charsRead < 0) {
-        error("Server: Error reading plaintext from socket");
+    // Streaming clients exchange data frame by frame instead of in one message
+    if (streaming) {
+        handleStream(connectionSocket);
     }
 
-    // Receive key
+    // Receive the request: a 4-byte length in network byte order, then that many plaintext and key characters
+    uint32_t header;
+    size_t length = 0;
+    memset(plaintext, '\0', sizeof(plaintext));
     memset(key, '\0', sizeof(key));
-    charsRead = recv(connectionSocket, key, sizeof(key) - 1, 0);
-    if (charsRead < 0) {
-        error("Server: Error reading key from socket");
+    if (recvAll(connectionSocket, (char*) &header, sizeof(header))) {
+        length = ntohl(header);
+    }
+    // Reject requests that are empty, too large, cut short, or hold fewer characters than announced
+    if (length == 0 || length >= BUFFER_SIZE
+            || !recvAll(connectionSocket, plaintext, length) || !recvAll(connectionSocket, key, length)
+            || strlen(plaintext) != length || strlen(key) != length) {
+        fprintf(stderr, "Server: Error, malformed request\n");
+        close(connectionSocket);
+        exit(1);
     }
 
     // Perform encryption
-    encrypt(plaintext, key, ciphertext);
+    // Large requests are encrypted in slices, each waiting for a bulk slot, so small ones can jump ahead
+    memset(ciphertext, '\0', sizeof(ciphertext));
+    if (strlen(plaintext) > SMALL_REQUEST_LIMIT) {
+        becomeBulk();
+        encryptInSlices(plaintext, key, ciphertext);
+    } else {
+        encrypt(plaintext, key, ciphertext);
+    }
 
-    // Send ciphertext back to client
-    charsWritten = send(connectionSocket, ciphertext, strlen(ciphertext), 0);
-    if (charsWritten < 0) {
-        error("Server: Error sending ciphertext");
+    // Refuse to return ciphertext made with key material that has been used before
+    if (strlen(ciphertext) > 0 && checkAndRecordKey(key, length)) {
+        fprintf(stderr, "Server: Error, key has already been used\n");
+        refuseConnection(connectionSocket);
     }
 
+    // Send the ciphertext back; closing the connection marks its end
+    sendAll(connectionSocket, ciphertext, strlen(ciphertext), "Server: Error sending ciphertext");
+
     // Close the connection socket
     close(connectionSocket);
     exit(0);
@@ -131,10 +527,15 @@ int main(int argc, char *argv[]) {
 
     // Check if the correct number of arguments is provided
     if (argc < 2) { 
-        fprintf(stderr,"Using: %s port\n", argv[0]); 
+        fprintf(stderr,"Using: %s port [padindex]\n", argv[0]); 
         exit(1);
     } 
 
+    // Enable pad-reuse detection when an index file is given
+    if (argc > 2) {
+        openPadIndex(argv[2]);
+    }
+
     // Create a socket
     listenSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (listenSocket < 0) {
@@ -161,6 +562,16 @@ int main(int argc, char *argv[]) {
         error("sigaction");
     }
 
+    // Create the bulk slots and remove them again when the server is stopped
+    createBulkSlots();
+    struct sigaction stop;
+    stop.sa_handler = stopServer;
+    sigemptyset(&stop.sa_mask);
+    stop.sa_flags = 0;
+    if (sigaction(SIGINT, &stop, NULL) == -1 || sigaction(SIGTERM, &stop, NULL) == -1) {
+        error("sigaction");
+    }
+
     // Main loop to accept and handle incoming connections
     while (1) {
         // Accept a new connection
@@ -177,6 +588,8 @@ int main(int argc, char *argv[]) {
         if (pid == 0) {
             // In the child process: close the listening socket and handle the client
             close(listenSocket);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
             handleClient(connectionSocket);
         } else {
             // In the parent process: close the connection socket